@@ -0,0 +1,370 @@
+# Soak test: ramps up concurrent pty sessions running a chatty workload and
+# samples the footprint of the BEAM and the port_pty processes over time.
+#
+# Linux only, as it reads most of its metrics from /proc.
+#
+#     mix run bench/soak.exs --sessions 20000 --step 1000
+#
+# Opening tens of thousands of sessions needs raised limits, e.g.
+#
+#     ulimit -n 1048576
+#     sudo sysctl kernel.pty.max=65536   # or pass --pty-max as root
+#     elixir --erl "+Q 1048576 +P 4194304" -S mix run bench/soak.exs
+#
+# Options:
+#
+#   * `--sessions` - number of sessions to ramp up to (default 10000)
+#   * `--step` - sessions started per sample interval (default 500)
+#   * `--interval` - sample interval in milliseconds (default 1000)
+#   * `--chatter` - milliseconds between lines each session writes (default 1000)
+#   * `--hold` - milliseconds to keep all sessions running after the ramp
+#     (default 30000)
+#   * `--max-latency` - p99 output latency in milliseconds that counts as
+#     broken (default 1000). Sessions that did not echo anything for longer
+#     than `--chatter` plus this count as stalled, which is broken as well.
+#   * `--pty-max` - write this value to /proc/sys/kernel/pty/max before starting
+#   * `--csv` - also write the samples to this file
+
+defmodule ExPTY.Soak do
+  @switches [
+    sessions: :integer,
+    step: :integer,
+    interval: :integer,
+    chatter: :integer,
+    hold: :integer,
+    max_latency: :integer,
+    pty_max: :integer,
+    csv: :string
+  ]
+
+  @defaults [
+    sessions: 10_000,
+    step: 500,
+    interval: 1000,
+    chatter: 1000,
+    hold: 30_000,
+    max_latency: 1000
+  ]
+
+  @columns ~w(time_ms sessions failed stalled beam_total_mb beam_proc_mb
+              beam_bin_mb beam_fds rss_per_session_kb os_procs ptys sched_util
+              lat_p50_ms lat_p99_ms lat_max_ms)
+
+  def run(argv) do
+    {opts, _, _} = OptionParser.parse(argv, strict: @switches)
+    opts = Keyword.merge(@defaults, opts)
+
+    if pty_max = opts[:pty_max], do: File.write!("/proc/sys/kernel/pty/max", to_string(pty_max))
+    preflight(opts)
+
+    :erlang.system_flag(:scheduler_wall_time, true)
+    csv = opts[:csv] && File.open!(opts[:csv], [:write])
+    emit(csv, @columns)
+
+    collector = self()
+    start = System.monotonic_time(:millisecond)
+
+    state = %{
+      opts: opts,
+      csv: csv,
+      collector: collector,
+      start: start,
+      sessions: [],
+      os_pids: %{},
+      last_echo: %{},
+      ptys: read_proc("/proc/sys/kernel/pty/nr"),
+      failed: 0,
+      failures: %{},
+      latencies: [],
+      wall_time: :erlang.statistics(:scheduler_wall_time),
+      broken: nil
+    }
+
+    state = ramp(state)
+    state = hold(state, start_time() + opts[:hold])
+    report(state)
+    teardown(state)
+  end
+
+  defp preflight(opts) do
+    limits = File.read!("/proc/self/limits")
+    [_, nofile] = Regex.run(~r/Max open files\s+(\S+)/, limits)
+    [_, nproc] = Regex.run(~r/Max processes\s+(\S+)/, limits)
+
+    IO.puts("""
+    target sessions:  #{opts[:sessions]}
+    kernel.pty.max:   #{read_proc("/proc/sys/kernel/pty/max")}
+    kernel.pty.nr:    #{read_proc("/proc/sys/kernel/pty/nr")}
+    max open files:   #{nofile}
+    max processes:    #{nproc}
+    erlang ports:     #{:erlang.system_info(:port_limit)}
+    erlang processes: #{:erlang.system_info(:process_limit)}
+    """)
+  end
+
+  defp ramp(state) do
+    %{opts: opts} = state
+
+    if state.broken || length(state.sessions) >= opts[:sessions] do
+      state
+    else
+      n = min(opts[:step], opts[:sessions] - length(state.sessions))
+      started = for _ <- 1..n, do: start_session(state.collector, opts[:chatter])
+      state = sample(%{state | sessions: started ++ state.sessions})
+      ramp(state)
+    end
+  end
+
+  defp hold(state, until) do
+    if state.broken || start_time() >= until do
+      state
+    else
+      hold(sample(state), until)
+    end
+  end
+
+  defp start_time, do: System.monotonic_time(:millisecond)
+
+  # the collector monitors every session, so sessions crashing during startup
+  # (e.g. because port_pty exited) count as failures, too
+  defp start_session(collector, chatter) do
+    {pid, _ref} =
+      spawn_monitor(fn ->
+        Process.flag(:trap_exit, true)
+
+        case ExPTY.start_link(handler: self()) do
+          {:ok, pty} ->
+            send(collector, {:started, self(), ExPTY.os_pid(pty)})
+            :ok = ExPTY.set_pty_opts(pty, echo: 0)
+            ExPTY.exec(pty, ["cat"])
+            Process.send_after(self(), :chatter, :rand.uniform(chatter))
+            session(%{pty: pty, collector: collector, chatter: chatter, buffer: ""})
+
+          {:error, reason} ->
+            send(collector, {:failed, self(), reason})
+        end
+      end)
+
+    pid
+  end
+
+  defp session(state = %{pty: pty}) do
+    receive do
+      :chatter ->
+        ExPTY.send_data(pty, "ping #{System.monotonic_time(:microsecond)}\n")
+        Process.send_after(self(), :chatter, state.chatter)
+        session(state)
+
+      {^pty, {:data, data}} ->
+        lines = String.split(state.buffer <> data, "\r\n")
+        {complete, [rest]} = Enum.split(lines, -1)
+        now = System.monotonic_time(:microsecond)
+
+        for "ping " <> ts <- complete do
+          send(state.collector, {:latency, self(), now - String.to_integer(ts)})
+        end
+
+        session(%{state | buffer: rest})
+
+      {^pty, {:exit, code}} ->
+        send(state.collector, {:failed, self(), {:exit, code}})
+
+      {:EXIT, ^pty, reason} ->
+        send(state.collector, {:failed, self(), {:port_exited, reason}})
+
+      {^pty, _} ->
+        session(state)
+
+      :stop ->
+        :ok = ExPTY.kill(pty, 1000)
+
+        receive do
+          {:EXIT, ^pty, _} -> :ok
+        after
+          5000 -> :ok
+        end
+    end
+  end
+
+  defp sample(state) do
+    deadline = start_time() + state.opts[:interval]
+    state = collect(state, deadline)
+
+    latencies = Enum.sort(state.latencies)
+    wall_time = :erlang.statistics(:scheduler_wall_time)
+    memory = :erlang.memory()
+    sessions = length(state.sessions) - state.failed
+    stalled = stalled(state)
+
+    row = [
+      start_time() - state.start,
+      sessions,
+      state.failed,
+      stalled,
+      mb(memory[:total]),
+      mb(memory[:processes]),
+      mb(memory[:binary]),
+      length(File.ls!("/proc/self/fd")),
+      rss_per_session(state.os_pids),
+      Enum.count(File.ls!("/proc"), &match?({_, ""}, Integer.parse(&1))),
+      read_proc("/proc/sys/kernel/pty/nr"),
+      Float.round(utilization(state.wall_time, wall_time), 3),
+      percentile(latencies, 0.5),
+      percentile(latencies, 0.99),
+      percentile(latencies, 1.0)
+    ]
+
+    emit(state.csv, row)
+
+    broken =
+      cond do
+        state.broken -> state.broken
+        state.failed > 0 -> {sessions, {:failed, state.failures}}
+        stalled > 0 -> {sessions, {:stalled, stalled}}
+        percentile(latencies, 0.99) > state.opts[:max_latency] -> {sessions, :latency}
+        true -> nil
+      end
+
+    %{state | latencies: [], wall_time: wall_time, broken: broken}
+  end
+
+  # process collector messages until the deadline
+  defp collect(state, deadline) do
+    timeout = max(deadline - start_time(), 0)
+
+    receive do
+      {:latency, pid, us} ->
+        last_echo = Map.put(state.last_echo, pid, start_time())
+        collect(%{state | latencies: [us | state.latencies], last_echo: last_echo}, deadline)
+
+      {:started, pid, os_pid} ->
+        os_pids = Map.put(state.os_pids, pid, os_pid)
+        last_echo = Map.put(state.last_echo, pid, start_time())
+        collect(%{state | os_pids: os_pids, last_echo: last_echo}, deadline)
+
+      {:failed, pid, reason} ->
+        collect(fail(state, pid, reason), deadline)
+
+      {:DOWN, _ref, :process, pid, reason} when reason != :normal ->
+        collect(fail(state, pid, failure_kind(reason)), deadline)
+
+      {:DOWN, _ref, :process, _pid, :normal} ->
+        collect(state, deadline)
+    after
+      timeout -> state
+    end
+  end
+
+  defp fail(state, pid, reason) do
+    %{
+      state
+      | os_pids: Map.delete(state.os_pids, pid),
+        last_echo: Map.delete(state.last_echo, pid),
+        failed: state.failed + 1,
+        failures: Map.update(state.failures, reason, 1, &(&1 + 1))
+    }
+  end
+
+  # calls into an ExPTY time out when the BEAM is overloaded and fail with
+  # any other reason when its port_pty exited
+  defp failure_kind({:timeout, {GenServer, :call, [_server, request, _timeout]}}),
+    do: {:call_timeout, request}
+
+  defp failure_kind({reason, {GenServer, :call, _}}), do: {:port_exited, reason}
+  defp failure_kind(reason), do: {:crashed, reason}
+
+  # sessions without any echo, e.g. because cat never started or its
+  # output stalls, do not contribute latency samples
+  defp stalled(state) do
+    since = start_time() - state.opts[:chatter] - state.opts[:max_latency]
+    Enum.count(state.last_echo, fn {_pid, last} -> last < since end)
+  end
+
+  # RSS of the port_pty process and its helper child for a sample of sessions
+  defp rss_per_session(os_pids) do
+    samples =
+      os_pids
+      |> Map.values()
+      |> Enum.take(50)
+      |> Enum.map(fn os_pid -> Enum.sum(Enum.map([os_pid | children(os_pid)], &rss/1)) end)
+
+    if samples == [], do: 0, else: div(Enum.sum(samples), length(samples))
+  end
+
+  defp children(os_pid) do
+    case File.read("/proc/#{os_pid}/task/#{os_pid}/children") do
+      {:ok, children} -> Enum.map(String.split(children), &String.to_integer/1)
+      {:error, _} -> []
+    end
+  end
+
+  defp rss(os_pid) do
+    with {:ok, status} <- File.read("/proc/#{os_pid}/status"),
+         [_, kb] <- Regex.run(~r/VmRSS:\s+(\d+) kB/, status) do
+      String.to_integer(kb)
+    else
+      _ -> 0
+    end
+  end
+
+  defp utilization(before, now) do
+    {active, total} =
+      Enum.zip(Enum.sort(before), Enum.sort(now))
+      |> Enum.reduce({0, 0}, fn {{_, a0, t0}, {_, a1, t1}}, {active, total} ->
+        {active + (a1 - a0), total + (t1 - t0)}
+      end)
+
+    if total == 0, do: 0.0, else: active / total
+  end
+
+  defp percentile([], _), do: 0
+
+  defp percentile(sorted, p) do
+    index = min(round(p * length(sorted)), length(sorted) - 1)
+    div(Enum.at(sorted, index), 1000)
+  end
+
+  defp report(state) do
+    case state.broken do
+      nil ->
+        IO.puts("\nreached #{length(state.sessions)} sessions without failures")
+
+      {sessions, :latency} ->
+        max_latency = state.opts[:max_latency]
+        IO.puts("\nscaling broke at #{sessions} sessions: p99 latency above #{max_latency}ms")
+
+      {sessions, {:failed, failures}} ->
+        IO.puts("\nscaling broke at #{sessions} sessions: #{inspect(failures)}")
+
+      {sessions, {:stalled, stalled}} ->
+        IO.puts("\nscaling broke at #{sessions} sessions: #{stalled} sessions stopped echoing")
+    end
+  end
+
+  defp teardown(state) do
+    started = start_time()
+    Enum.each(state.sessions, &send(&1, :stop))
+    wait_for_ptys(state.ptys, started + 30_000)
+    IO.puts("teardown of #{length(state.sessions)} sessions took #{start_time() - started}ms")
+  end
+
+  defp wait_for_ptys(ptys, deadline) do
+    if read_proc("/proc/sys/kernel/pty/nr") > ptys and start_time() < deadline do
+      Process.sleep(100)
+      wait_for_ptys(ptys, deadline)
+    end
+  end
+
+  defp read_proc(path), do: path |> File.read!() |> String.trim() |> String.to_integer()
+
+  defp mb(bytes), do: div(bytes, 1024 * 1024)
+
+  defp emit(nil, row), do: IO.puts(Enum.join(row, "\t"))
+
+  defp emit(csv, row) do
+    IO.write(csv, Enum.join(row, ",") <> "\n")
+    emit(nil, row)
+  end
+end
+
+ExPTY.Soak.run(System.argv())
@@ -1,15 +1,27 @@
 // code adapted from http://www.rkoucha.fr/tech_corner/pty_pdip.html
 #define _XOPEN_SOURCE 600
+#ifdef __linux__
+// sched_setaffinity
+#define _GNU_SOURCE
+#endif
 #include "ei.h"
 #include "erl_comm.h"
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/select.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 typedef unsigned char byte;
@@ -78,6 +90,635 @@ void set_tty_opt(struct termios *tio, char atom[], long value) {
 #undef STRLEN
 }
 
+// exec opts: resource isolation applied in the exec child, see ExPTY.exec/4
+
+#define MAX_RLIMITS 8
+// see linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+struct exec_opts {
+  int n_rlimits;
+  int rlimit_resource[MAX_RLIMITS];
+  rlim_t rlimit_soft[MAX_RLIMITS];
+  // only changed when given explicitly, so the child may still raise its
+  // soft limit up to the hard one
+  int set_rlimit_hard[MAX_RLIMITS];
+  rlim_t rlimit_hard[MAX_RLIMITS];
+  int set_nice;
+  int nice;
+  int set_ionice;
+  int ionice;
+#ifdef __linux__
+  int set_affinity;
+  cpu_set_t affinity;
+#endif
+  char cgroup[PATH_MAX];
+};
+
+static int rlimit_resource(char atom[]) {
+  if (strcmp(atom, "cpu") == 0)
+    return RLIMIT_CPU;
+  if (strcmp(atom, "as") == 0)
+    return RLIMIT_AS;
+  if (strcmp(atom, "nofile") == 0)
+    return RLIMIT_NOFILE;
+  if (strcmp(atom, "nproc") == 0)
+    return RLIMIT_NPROC;
+  return -1;
+}
+
+static int ionice_class(char atom[]) {
+  if (strcmp(atom, "realtime") == 0)
+    return 1;
+  if (strcmp(atom, "best_effort") == 0)
+    return 2;
+  if (strcmp(atom, "idle") == 0)
+    return 3;
+  return -1;
+}
+
+// limit | infinity
+static void decode_rlim(byte *buf, int *index, rlim_t *rlim) {
+  char atom[MAXATOMLEN];
+  long value;
+
+  if (ei_decode_long(buf, index, &value) == 0) {
+    *rlim = (rlim_t)value;
+  } else if (ei_decode_atom(buf, index, atom) == 0 &&
+             strcmp(atom, "infinity") == 0) {
+    *rlim = RLIM_INFINITY;
+  } else {
+    fail(__LINE__);
+  }
+}
+
+static void decode_exec_opts(byte *buf, int *index, struct exec_opts *opts) {
+  int arity, type, size;
+  char atom[MAXATOMLEN];
+
+  memset(opts, 0, sizeof(*opts));
+  if (ei_decode_list_header(buf, index, &arity) != 0)
+    fail(__LINE__);
+  int list_length = arity;
+  for (int i = 0; i < list_length; i++) {
+    if (ei_decode_tuple_header(buf, index, &arity) != 0 || arity != 2)
+      fail(__LINE__);
+    if (ei_decode_atom(buf, index, atom) != 0)
+      fail(__LINE__);
+
+    if (strcmp(atom, "rlimit") == 0) {
+      // [{resource, soft | {soft, hard}}]
+      if (ei_decode_list_header(buf, index, &arity) != 0)
+        fail(__LINE__);
+      int n = arity;
+      for (int j = 0; j < n; j++) {
+        if (ei_decode_tuple_header(buf, index, &arity) != 0 || arity != 2)
+          fail(__LINE__);
+        if (ei_decode_atom(buf, index, atom) != 0)
+          fail(__LINE__);
+        int resource = rlimit_resource(atom);
+        if (resource < 0 || opts->n_rlimits >= MAX_RLIMITS)
+          fail(__LINE__);
+        int k = opts->n_rlimits++;
+        opts->rlimit_resource[k] = resource;
+        if (ei_get_type(buf, index, &type, &size) != 0)
+          fail(__LINE__);
+        if (type == ERL_SMALL_TUPLE_EXT) {
+          if (ei_decode_tuple_header(buf, index, &arity) != 0 || arity != 2)
+            fail(__LINE__);
+          decode_rlim(buf, index, &opts->rlimit_soft[k]);
+          decode_rlim(buf, index, &opts->rlimit_hard[k]);
+          opts->set_rlimit_hard[k] = 1;
+        } else {
+          decode_rlim(buf, index, &opts->rlimit_soft[k]);
+        }
+      }
+      if (n > 0 && ei_decode_list_header(buf, index, &arity) != 0)
+        fail(__LINE__);
+    } else if (strcmp(atom, "nice") == 0) {
+      long value;
+      if (ei_decode_long(buf, index, &value) != 0)
+        fail(__LINE__);
+      opts->set_nice = 1;
+      opts->nice = (int)value;
+    } else if (strcmp(atom, "ionice") == 0) {
+      // {class, level}
+      long level;
+      if (ei_decode_tuple_header(buf, index, &arity) != 0 || arity != 2)
+        fail(__LINE__);
+      if (ei_decode_atom(buf, index, atom) != 0)
+        fail(__LINE__);
+      int class = ionice_class(atom);
+      if (class < 0)
+        fail(__LINE__);
+      if (ei_decode_long(buf, index, &level) != 0)
+        fail(__LINE__);
+      opts->set_ionice = 1;
+      opts->ionice = (class << IOPRIO_CLASS_SHIFT) | (int)level;
+    } else if (strcmp(atom, "affinity") == 0) {
+      // list of cpu numbers; small integer lists are encoded as strings
+      if (ei_get_type(buf, index, &type, &size) != 0)
+        fail(__LINE__);
+#ifdef __linux__
+      opts->set_affinity = 1;
+      CPU_ZERO(&opts->affinity);
+#endif
+      if (type == ERL_STRING_EXT) {
+        char *cpus = (char *)malloc(size + 1);
+        if (cpus == NULL)
+          fail(__LINE__);
+        if (ei_decode_string(buf, index, cpus) != 0)
+          fail(__LINE__);
+#ifdef __linux__
+        for (int j = 0; j < size; j++)
+          CPU_SET((byte)cpus[j], &opts->affinity);
+#endif
+        free(cpus);
+      } else {
+        if (ei_decode_list_header(buf, index, &arity) != 0)
+          fail(__LINE__);
+        int n = arity;
+        for (int j = 0; j < n; j++) {
+          long cpu;
+          if (ei_decode_long(buf, index, &cpu) != 0)
+            fail(__LINE__);
+#ifdef __linux__
+          CPU_SET(cpu, &opts->affinity);
+#endif
+        }
+        if (n > 0 && ei_decode_list_header(buf, index, &arity) != 0)
+          fail(__LINE__);
+      }
+    } else if (strcmp(atom, "cgroup") == 0) {
+      if (ei_get_type(buf, index, &type, &size) != 0)
+        fail(__LINE__);
+      if (size >= PATH_MAX)
+        fail(__LINE__);
+      long len;
+      if (ei_decode_binary(buf, index, opts->cgroup, &len) < 0)
+        fail(__LINE__);
+      opts->cgroup[len] = '\0';
+    } else {
+      DEBUG(debug, "unknown exec opt %s\r\n", atom);
+      fail(__LINE__);
+    }
+  }
+  if (list_length > 0 && ei_decode_list_header(buf, index, &arity) != 0)
+    fail(__LINE__);
+}
+
+// returns -1 and leaves errno set if any of the options cannot be applied
+static int apply_exec_opts(struct exec_opts *opts) {
+  if (opts->cgroup[0] != '\0') {
+    // join the cgroup v2 by writing our pid to its cgroup.procs
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", opts->cgroup);
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+      return -1;
+    char pid[16];
+    int len = snprintf(pid, sizeof(pid), "%d", getpid());
+    int r = write(fd, pid, len);
+    close(fd);
+    if (r != len)
+      return -1;
+  }
+
+  // affinity and ionice are linux only and silently ignored elsewhere
+#ifdef __linux__
+  if (opts->set_affinity &&
+      sched_setaffinity(0, sizeof(opts->affinity), &opts->affinity) != 0)
+    return -1;
+  if (opts->set_ionice && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                                  opts->ionice) != 0)
+    return -1;
+#endif
+
+  if (opts->set_nice && setpriority(PRIO_PROCESS, 0, opts->nice) != 0)
+    return -1;
+
+  for (int i = 0; i < opts->n_rlimits; i++) {
+    struct rlimit rl;
+    if (getrlimit(opts->rlimit_resource[i], &rl) != 0)
+      return -1;
+    rl.rlim_cur = opts->rlimit_soft[i];
+    if (opts->set_rlimit_hard[i])
+      rl.rlim_max = opts->rlimit_hard[i];
+    if (setrlimit(opts->rlimit_resource[i], &rl) != 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+// kill: SIGTERM to the session, escalated to SIGKILL by the event loop, see
+// ExPTY.kill/2
+
+// while waiting for the session to terminate, check this often whether it is
+// already gone
+#define KILL_POLL_MS 10
+
+struct kill_state {
+  // deadline for escalating to SIGKILL, -1 if not killing
+  long deadline;
+  pid_t pgrp;
+  pid_t sid;
+  // processes of the session outside of the two groups above, e.g.
+  // background jobs of a job control shell, collected when the kill starts
+  pid_t *pids;
+  int n_pids;
+  int cap_pids;
+};
+
+static int group_alive(pid_t pgrp) {
+  return pgrp > 0 && (kill(-pgrp, 0) == 0 || errno != ESRCH);
+}
+
+#ifdef __linux__
+static int read_stat(pid_t pid, char *state, int *pgrp, int *session) {
+  char path[64], stat[512];
+  int ppid;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  int len = read(fd, stat, sizeof(stat) - 1);
+  close(fd);
+  if (len <= 0)
+    return -1;
+  stat[len] = '\0';
+
+  // pid (comm) state ppid pgrp session ..., comm may contain anything
+  char *rest = strrchr(stat, ')');
+  if (rest == NULL ||
+      sscanf(rest + 1, " %c %d %d %d", state, &ppid, pgrp, session) != 4)
+    return -1;
+  return 0;
+}
+
+// remember pid if it belongs to the session but not to one of the groups,
+// which are signaled as a whole
+static void collect_pid(struct kill_state *k, pid_t pid) {
+  char state;
+  int pgrp, session;
+
+  if (pid <= 0 || pid == getpid() || read_stat(pid, &state, &pgrp, &session))
+    return;
+  // zombies are already dead, they just wait for their parent
+  if (session != k->sid || state == 'Z' || pgrp == k->pgrp || pgrp == k->sid)
+    return;
+
+  if (k->n_pids == k->cap_pids) {
+    k->cap_pids = k->cap_pids ? k->cap_pids * 2 : 16;
+    k->pids = (pid_t *)realloc(k->pids, k->cap_pids * sizeof(pid_t));
+    if (k->pids == NULL)
+      fail(__LINE__);
+  }
+  k->pids[k->n_pids++] = pid;
+}
+
+// the cgroup v2 path of pid, see the cgroup exec opt
+static int read_cgroup(pid_t pid, char *cgroup, size_t size) {
+  char path[64], line[PATH_MAX];
+  int found = 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  while (!found && fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "0::", 3) == 0) {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(cgroup, size, "%s", line + 3);
+      found = 1;
+    }
+  }
+  fclose(f);
+  return found;
+}
+#endif
+
+// find the processes of the session that are not in one of the groups. When
+// the session leader was placed in a cgroup of its own, only its members
+// are candidates, otherwise all of /proc is scanned.
+static void collect_session(struct kill_state *k) {
+  k->n_pids = 0;
+#ifdef __linux__
+  if (k->sid <= 0)
+    return;
+
+  char own[PATH_MAX], session[PATH_MAX];
+  if (read_cgroup(getpid(), own, sizeof(own)) &&
+      read_cgroup(k->sid, session, sizeof(session)) &&
+      strcmp(own, session) != 0) {
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cgroup.procs", session);
+    FILE *procs = fopen(path, "r");
+    if (procs != NULL) {
+      int pid;
+      while (fscanf(procs, "%d", &pid) == 1)
+        collect_pid(k, pid);
+      fclose(procs);
+      return;
+    }
+  }
+
+  DIR *proc = opendir("/proc");
+  if (proc == NULL)
+    return;
+  struct dirent *entry;
+  while ((entry = readdir(proc)) != NULL) {
+    char *end;
+    pid_t pid = strtol(entry->d_name, &end, 10);
+    if (*end == '\0')
+      collect_pid(k, pid);
+  }
+  closedir(proc);
+#endif
+}
+
+// send sig to the groups and the collected processes of the session and
+// return how many of them are still alive; sig 0 only counts
+static int signal_session(struct kill_state *k, int sig) {
+  int alive = 0;
+
+  if (group_alive(k->pgrp)) {
+    alive++;
+    if (sig)
+      kill(-k->pgrp, sig);
+  }
+  if (k->sid != k->pgrp && group_alive(k->sid)) {
+    alive++;
+    if (sig)
+      kill(-k->sid, sig);
+  }
+  for (int i = 0; i < k->n_pids; i++) {
+    if (k->pids[i] <= 0)
+      continue;
+    if (sig) {
+      kill(k->pids[i], sig);
+      alive++;
+      continue;
+    }
+#ifdef __linux__
+    // only the collected pids are checked, zombies count as gone
+    char state;
+    int pgrp, session;
+    if (read_stat(k->pids[i], &state, &pgrp, &session) == 0 &&
+        session == k->sid && state != 'Z')
+      alive++;
+    else
+      k->pids[i] = 0;
+#endif
+  }
+
+  return alive;
+}
+
+static void start_kill(int fdm, struct kill_state *k, long grace, long now) {
+  // the foreground job and the session leader's process group may differ,
+  // e.g. when a shell runs a pipeline
+  k->pgrp = tcgetpgrp(fdm);
+  k->sid = tcgetsid(fdm);
+  k->deadline = now + grace;
+  collect_session(k);
+  DEBUG(debug, "kill pgrp=%d sid=%d pids=%d grace=%ld\r\n", k->pgrp, k->sid,
+        k->n_pids, grace);
+  signal_session(k, SIGTERM);
+  signal_session(k, SIGCONT);
+}
+
+// milliseconds until the session should be checked again
+static long kill_timeout(struct kill_state *k, long now) {
+  long remaining = k->deadline - now;
+  if (remaining < 0)
+    return 0;
+  return remaining < KILL_POLL_MS ? remaining : KILL_POLL_MS;
+}
+
+static void finish_kill(struct kill_state *k, pid_t child) {
+  // look once more for processes started since the kill began
+  collect_session(k);
+  signal_session(k, SIGKILL);
+  // the child keeps the slave side of the pty open
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  exit(0);
+}
+
+// timeouts: inactivity tracking in the event loop, see ExPTY.set_timeouts/2
+
+#define IDLE_NOTIFY 0
+#define IDLE_CLOSE 1
+#define IDLE_SIGNAL 2
+// grace period before idle sessions are killed, same as ExPTY.kill/2
+#define IDLE_CLOSE_GRACE_MS 5000
+
+struct timeouts {
+  // 0 disables the respective timeout
+  long quiet;
+  long idle_input;
+  long idle_output;
+  int idle_action;
+  int idle_signal;
+  // last activity and whether the timeouts already fired since then
+  long last_input;
+  long last_output;
+  int quiet_sent;
+  int idle_input_sent;
+  int idle_output_sent;
+};
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int signal_number(char atom[]) {
+#define SIGNAL(NAME, SIG)                                                      \
+  if (strcmp(atom, NAME) == 0)                                                 \
+    return SIG;
+  SIGNAL("sighup", SIGHUP)
+  SIGNAL("sigint", SIGINT)
+  SIGNAL("sigquit", SIGQUIT)
+  SIGNAL("sigkill", SIGKILL)
+  SIGNAL("sigusr1", SIGUSR1)
+  SIGNAL("sigusr2", SIGUSR2)
+  SIGNAL("sigalrm", SIGALRM)
+  SIGNAL("sigterm", SIGTERM)
+  SIGNAL("sigcont", SIGCONT)
+  SIGNAL("sigstop", SIGSTOP)
+  SIGNAL("sigtstp", SIGTSTP)
+  SIGNAL("sigwinch", SIGWINCH)
+#undef SIGNAL
+  return -1;
+}
+
+// deliver a signal to the foreground process group of the pty
+static int signal_foreground(int fdm, int sig) {
+  pid_t pgrp = tcgetpgrp(fdm);
+  if (pgrp == 0)
+    errno = ESRCH;
+  if (pgrp <= 0)
+    return -1;
+  return kill(-pgrp, sig);
+}
+
+static void decode_timeouts(byte *buf, int *index, struct timeouts *t) {
+  int arity;
+  char atom[MAXATOMLEN];
+
+  if (ei_decode_list_header(buf, index, &arity) != 0)
+    fail(__LINE__);
+  int list_length = arity;
+  for (int i = 0; i < list_length; i++) {
+    if (ei_decode_tuple_header(buf, index, &arity) != 0 || arity != 2)
+      fail(__LINE__);
+    if (ei_decode_atom(buf, index, atom) != 0)
+      fail(__LINE__);
+
+    if (strcmp(atom, "idle_action") == 0) {
+      // notify | close | {signal, sig}
+      if (ei_decode_atom(buf, index, atom) == 0) {
+        if (strcmp(atom, "notify") == 0)
+          t->idle_action = IDLE_NOTIFY;
+        else if (strcmp(atom, "close") == 0)
+          t->idle_action = IDLE_CLOSE;
+        else
+          fail(__LINE__);
+      } else {
+        if (ei_decode_tuple_header(buf, index, &arity) != 0 || arity != 2)
+          fail(__LINE__);
+        if (ei_decode_atom(buf, index, atom) != 0 ||
+            strcmp(atom, "signal") != 0)
+          fail(__LINE__);
+        if (ei_decode_atom(buf, index, atom) != 0)
+          fail(__LINE__);
+        t->idle_signal = signal_number(atom);
+        if (t->idle_signal < 0)
+          fail(__LINE__);
+        t->idle_action = IDLE_SIGNAL;
+      }
+      continue;
+    }
+
+    long value;
+    if (ei_decode_long(buf, index, &value) != 0)
+      fail(__LINE__);
+    if (strcmp(atom, "quiet") == 0) {
+      t->quiet = value;
+    } else if (strcmp(atom, "idle_input") == 0) {
+      t->idle_input = value;
+      t->idle_input_sent = 0;
+    } else if (strcmp(atom, "idle_output") == 0) {
+      t->idle_output = value;
+      t->idle_output_sent = 0;
+    } else {
+      fail(__LINE__);
+    }
+  }
+  if (list_length > 0 && ei_decode_list_header(buf, index, &arity) != 0)
+    fail(__LINE__);
+}
+
+// milliseconds until the next enabled timeout fires, -1 if there is none
+static long next_timeout(struct timeouts *t, long now) {
+  long next = -1;
+  long deadline;
+
+  if (t->quiet && !t->quiet_sent) {
+    deadline = t->last_output + t->quiet - now;
+    if (next < 0 || deadline < next)
+      next = deadline;
+  }
+  if (t->idle_input && !t->idle_input_sent) {
+    deadline = t->last_input + t->idle_input - now;
+    if (next < 0 || deadline < next)
+      next = deadline;
+  }
+  if (t->idle_output && !t->idle_output_sent) {
+    deadline = t->last_output + t->idle_output - now;
+    if (next < 0 || deadline < next)
+      next = deadline;
+  }
+  if (next != -1 && next < 0)
+    next = 0;
+  return next;
+}
+
+// answer :ok | {:error, err}
+static void write_response(erlang_ref *ref, int err) {
+  ei_x_buff res_buf;
+
+  if (ei_x_new_with_version(&res_buf) != 0)
+    fail(__LINE__);
+  if (ei_x_encode_tuple_header(&res_buf, 3) != 0)
+    fail(__LINE__);
+  if (ei_x_encode_atom(&res_buf, "response") != 0)
+    fail(__LINE__);
+  if (ei_x_encode_ref(&res_buf, ref) != 0)
+    fail(__LINE__);
+  if (err != 0) {
+    if (ei_x_encode_tuple_header(&res_buf, 2) != 0)
+      fail(__LINE__);
+    if (ei_x_encode_atom(&res_buf, "error") != 0)
+      fail(__LINE__);
+    if (ei_x_encode_long(&res_buf, err) != 0)
+      fail(__LINE__);
+  } else {
+    if (ei_x_encode_atom(&res_buf, "ok") != 0)
+      fail(__LINE__);
+  }
+  write_cmd_erl(res_buf.buff, res_buf.index);
+  if (ei_x_free(&res_buf) != 0)
+    fail(__LINE__);
+}
+
+static void write_quiet(long ms) {
+  ei_x_buff res_buf;
+
+  if (ei_x_new_with_version(&res_buf) != 0)
+    fail(__LINE__);
+  if (ei_x_encode_tuple_header(&res_buf, 2) != 0)
+    fail(__LINE__);
+  if (ei_x_encode_atom(&res_buf, "quiet") != 0)
+    fail(__LINE__);
+  if (ei_x_encode_long(&res_buf, ms) != 0)
+    fail(__LINE__);
+  write_cmd_erl(res_buf.buff, res_buf.index);
+  if (ei_x_free(&res_buf) != 0)
+    fail(__LINE__);
+}
+
+static void idle(int fdm, struct timeouts *t, const char *kind,
+                 struct kill_state *k, long now) {
+  ei_x_buff res_buf;
+
+  DEBUG(debug, "idle %s\r\n", kind);
+  if (ei_x_new_with_version(&res_buf) != 0)
+    fail(__LINE__);
+  if (ei_x_encode_tuple_header(&res_buf, 2) != 0)
+    fail(__LINE__);
+  if (ei_x_encode_atom(&res_buf, "idle") != 0)
+    fail(__LINE__);
+  if (ei_x_encode_atom(&res_buf, kind) != 0)
+    fail(__LINE__);
+  write_cmd_erl(res_buf.buff, res_buf.index);
+  if (ei_x_free(&res_buf) != 0)
+    fail(__LINE__);
+
+  if (t->idle_action == IDLE_CLOSE) {
+    // the event loop escalates and exits, just like for ExPTY.kill/2
+    if (k->deadline < 0)
+      start_kill(fdm, k, IDLE_CLOSE_GRACE_MS, now);
+  } else if (t->idle_action == IDLE_SIGNAL) {
+    signal_foreground(fdm, t->idle_signal);
+  }
+}
+
 // -----------------------------------------------------
 
 int main(int argc, char *argv[]) {
@@ -126,6 +767,7 @@ int main(int argc, char *argv[]) {
   int res = 0;
   erlang_ref reply_ref;
   ei_x_buff res_buf;
+  struct exec_opts exec_opts;
 
   // int res = 0;
   // ei_x_buff res_buf;
@@ -145,6 +787,15 @@ int main(int argc, char *argv[]) {
     // where messages are exchanged between parent and child
     int mode = 0;
 
+    struct timeouts timeouts;
+    memset(&timeouts, 0, sizeof(timeouts));
+    timeouts.quiet_sent = 1;
+    struct kill_state kill_state;
+    memset(&kill_state, 0, sizeof(kill_state));
+    kill_state.deadline = -1;
+    struct timeval tv;
+    long now, next;
+
     while (1) {
       // Wait for data from standard input and master side of PTY
       // using select
@@ -157,11 +808,22 @@ int main(int argc, char *argv[]) {
       if (fdm > PARENT_READ) {
         max_fd = fdm;
       }
-      rc = select(max_fd + 1, &fd_in, NULL, NULL, NULL);
+      // inactivity timeouts only start once the command is running
+      now = now_ms();
+      next = mode == 1 ? next_timeout(&timeouts, now) : -1;
+      if (kill_state.deadline >= 0) {
+        long poll = kill_timeout(&kill_state, now);
+        if (next < 0 || poll < next)
+          next = poll;
+      }
+      tv.tv_sec = next / 1000;
+      tv.tv_usec = (next % 1000) * 1000;
+      rc = select(max_fd + 1, &fd_in, NULL, NULL, next < 0 ? NULL : &tv);
       if (rc == -1) {
         DEBUG(debug, "Error %d on select()\r\n", errno);
         exit(1);
       }
+      now = now_ms();
 
       // data on erlang input
       if (FD_ISSET(ERL_READ, &fd_in)) {
@@ -194,14 +856,47 @@ int main(int argc, char *argv[]) {
             // write to pty master
             write(fdm, data, size);
             free(data);
+            timeouts.last_input = now;
+            timeouts.idle_input_sent = 0;
           } else if (strncmp(atom, "winsz", 5) == 0) {
             write_cmd(PARENT_WRITE, buf, rc);
           } else if (strncmp(atom, "pty_opts", 9) == 0) {
             // we must change the pty settings from the slave side, just relay
             // the message to the child
             write_cmd(PARENT_WRITE, buf, rc);
+          } else if (strncmp(atom, "timeouts", 8) == 0) {
+            // {timeouts, ref, opts} is handled by the event loop itself
+            if (ei_decode_ref(buf, &index, &reply_ref) != 0)
+              fail(__LINE__);
+            decode_timeouts(buf, &index, &timeouts);
+            write_response(&reply_ref, 0);
+          } else if (strncmp(atom, "signal", 6) == 0) {
+            // {signal, ref, sig}
+            if (ei_decode_ref(buf, &index, &reply_ref) != 0)
+              fail(__LINE__);
+            if (ei_decode_atom(buf, &index, atom) != 0)
+              fail(__LINE__);
+            int sig = signal_number(atom);
+            if (sig < 0)
+              fail(__LINE__);
+            rc = signal_foreground(fdm, sig);
+            write_response(&reply_ref, rc == 0 ? 0 : errno);
+          } else if (strncmp(atom, "kill", 4) == 0) {
+            // {kill, ref, grace_ms}
+            if (ei_decode_ref(buf, &index, &reply_ref) != 0)
+              fail(__LINE__);
+            long grace;
+            if (ei_decode_long(buf, &index, &grace) != 0)
+              fail(__LINE__);
+            write_response(&reply_ref, 0);
+            if (mode == 0)
+              finish_kill(&kill_state, child);
+            if (kill_state.deadline < 0)
+              start_kill(fdm, &kill_state, grace, now);
           } else if (strncmp(atom, "exec", 4) == 0) {
             mode = 1;
+            timeouts.last_input = now;
+            timeouts.last_output = now;
             write_cmd(PARENT_WRITE, buf, rc);
           } else {
             DEBUG(debug, "other command!\r\n");
@@ -231,6 +926,9 @@ int main(int argc, char *argv[]) {
           write_cmd_erl(res_buf.buff, res_buf.index);
           if (ei_x_free(&res_buf) != 0)
             fail(__LINE__);
+          timeouts.last_output = now;
+          timeouts.quiet_sent = 0;
+          timeouts.idle_output_sent = 0;
         } else {
           if (rc <= 0) {
             DEBUG(debug, "Error %d on read master PTY\r\n", errno);
@@ -250,6 +948,30 @@ int main(int argc, char *argv[]) {
           }
         }
       }
+
+      if (kill_state.deadline >= 0 &&
+          (now >= kill_state.deadline ||
+           signal_session(&kill_state, 0) == 0)) {
+        finish_kill(&kill_state, child);
+      }
+
+      if (mode == 1) {
+        if (timeouts.quiet && !timeouts.quiet_sent &&
+            now - timeouts.last_output >= timeouts.quiet) {
+          timeouts.quiet_sent = 1;
+          write_quiet(timeouts.quiet);
+        }
+        if (timeouts.idle_input && !timeouts.idle_input_sent &&
+            now - timeouts.last_input >= timeouts.idle_input) {
+          timeouts.idle_input_sent = 1;
+          idle(fdm, &timeouts, "input", &kill_state, now);
+        }
+        if (timeouts.idle_output && !timeouts.idle_output_sent &&
+            now - timeouts.last_output >= timeouts.idle_output) {
+          timeouts.idle_output_sent = 1;
+          idle(fdm, &timeouts, "output", &kill_state, now);
+        }
+      }
     }
   } else {
     char **child_av;
@@ -260,6 +982,10 @@ int main(int argc, char *argv[]) {
     close(PARENT_READ);
     close(PARENT_WRITE);
 
+    // reap exec children right away, so that a terminated session does not
+    // linger as zombies (see kill in the event loop)
+    signal(SIGCHLD, SIG_IGN);
+
     // open the slave side of the PTY; important that this happens in the
     // child otherwise we get ownership errors
     fds = open(ptsname(fdm), O_RDWR);
@@ -363,6 +1089,8 @@ int main(int argc, char *argv[]) {
           if (ei_x_free(&res_buf) != 0)
             fail(__LINE__);
         } else if (strncmp(atom, "exec", 4) == 0) {
+          // {exec, command, env} or {exec, command, env, opts}
+          int exec_arity = arity;
           if (ei_decode_list_header(buf, &index, &arity) != 0)
             fail(__LINE__);
 
@@ -416,11 +1144,19 @@ int main(int argc, char *argv[]) {
             free(data);
           }
           env[i - 1] = NULL;
+          // decode tail of list
+          if (arity > 0 && ei_decode_list_header(buf, &index, &arity) != 0)
+            fail(__LINE__);
+
+          memset(&exec_opts, 0, sizeof(exec_opts));
+          if (exec_arity == 4)
+            decode_exec_opts(buf, &index, &exec_opts);
 
           if (fork()) {
             DEBUG(debug, "forked!\r\n");
           } else {
             // child breaks
+            signal(SIGCHLD, SIG_DFL);
             break;
           }
         } else {
@@ -463,7 +1199,10 @@ int main(int argc, char *argv[]) {
     setpgid(0, 0);
 
     environ = env;
-    rc = execvp(child_av[0], child_av);
+    // resource limits, scheduling and cgroup placement; on failure errno is
+    // reported the same way as a failed exec
+    if (apply_exec_opts(&exec_opts) == 0)
+      rc = execvp(child_av[0], child_av);
     // send exit code to erlang
     if (ei_x_new_with_version(&res_buf) != 0)
       fail(__LINE__);
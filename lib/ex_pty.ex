@@ -6,6 +6,7 @@ defmodule ExPTY do
   """
 
   @target Mix.target()
+  @max_command_size 1024
 
   @doc """
   Opens the specific program inside a pseudo terminal.
@@ -47,8 +48,8 @@ defmodule ExPTY do
   end
 
   @impl true
-  def handle_cast({:exec, command, env}, state) do
-    Port.command(state.port, :erlang.term_to_binary({:exec, command, env}))
+  def handle_cast({:exec, command, env, opts}, state) do
+    Port.command(state.port, :erlang.term_to_binary({:exec, command, env, opts}))
 
     {:noreply, state}
   end
@@ -61,6 +62,12 @@ defmodule ExPTY do
   end
 
   @impl true
+  def handle_call(:os_pid, _from, state) do
+    {:os_pid, os_pid} = Port.info(state.port, :os_pid)
+
+    {:reply, os_pid, state}
+  end
+
   def handle_call({:winsz, rows, cols}, from, state) do
     ref = make_ref()
     Port.command(state.port, :erlang.term_to_binary({:winsz, ref, rows, cols}))
@@ -75,6 +82,27 @@ defmodule ExPTY do
     {:noreply, update_in(state, [:callers], &Map.put(&1, ref, from))}
   end
 
+  def handle_call({:timeouts, timeouts}, from, state) do
+    ref = make_ref()
+    Port.command(state.port, :erlang.term_to_binary({:timeouts, ref, timeouts}))
+
+    {:noreply, update_in(state, [:callers], &Map.put(&1, ref, from))}
+  end
+
+  def handle_call({:signal, sig}, from, state) do
+    ref = make_ref()
+    Port.command(state.port, :erlang.term_to_binary({:signal, ref, sig}))
+
+    {:noreply, update_in(state, [:callers], &Map.put(&1, ref, from))}
+  end
+
+  def handle_call({:kill, grace_ms}, from, state) do
+    ref = make_ref()
+    Port.command(state.port, :erlang.term_to_binary({:kill, ref, grace_ms}))
+
+    {:noreply, update_in(state, [:callers], &Map.put(&1, ref, from))}
+  end
+
   @impl true
   def handle_info({port, {:data, data}}, state = %{port: port}) do
     case :erlang.binary_to_term(data) do
@@ -90,6 +118,14 @@ defmodule ExPTY do
       {:exit, code} ->
         send(state.handler, {self(), {:exit, code}})
         {:noreply, state}
+
+      {:quiet, ms} ->
+        send(state.handler, {self(), {:quiet, ms}})
+        {:noreply, state}
+
+      {:idle, kind} ->
+        send(state.handler, {self(), {:idle, kind}})
+        {:noreply, state}
     end
   end
 
@@ -99,8 +135,43 @@ defmodule ExPTY do
     {:stop, reason, state}
   end
 
-  def exec(server, command, env \\ []) do
-    GenServer.cast(server, {:exec, command, Enum.map(env, &map_env/1)})
+  @doc """
+  Executes the command inside the pty.
+
+  ## Options
+
+  The options are applied in the child right before the command is executed.
+  If any of them fails, the handler receives `{:exit, errno}` just like when
+  the command itself cannot be executed.
+
+    * `:rlimit` - a keyword list of resource limits (`:cpu`, `:as`, `:nofile`,
+      `:nproc`). A single integer or `:infinity` sets the soft limit only,
+      `{soft, hard}` sets both.
+    * `:affinity` - a list of CPUs the command may run on (Linux only)
+    * `:nice` - the nice value of the command
+    * `:ionice` - a `{class, level}` tuple, where class is one of `:realtime`,
+      `:best_effort` or `:idle` and level is between 0 and 7 (Linux only)
+    * `:cgroup` - the path of a cgroup v2 directory to join, e.g.
+      `"/sys/fs/cgroup/sessions"`
+
+  ## Example
+
+      iex> ExPTY.exec(pty, ["bash"], ["TERM=xterm"], rlimit: [nofile: 256], nice: 10)
+  """
+  def exec(server, command, env \\ [], opts \\ []) do
+    opts =
+      opts
+      |> Keyword.validate!([:rlimit, :affinity, :nice, :ionice, :cgroup])
+      |> Enum.map(&map_exec_opt/1)
+
+    message = {:exec, command, Enum.map(env, &map_env/1), opts}
+
+    # port_pty reads commands into a fixed buffer (ERL_BUF_SIZE)
+    if byte_size(:erlang.term_to_binary(message)) > @max_command_size do
+      raise ArgumentError, "exec command, env and options exceed #{@max_command_size} bytes"
+    end
+
+    GenServer.cast(server, message)
   end
 
   @doc """
@@ -121,6 +192,99 @@ defmodule ExPTY do
     GenServer.call(server, {:pty_opts, pty_opts})
   end
 
+  @signals [
+    :sighup,
+    :sigint,
+    :sigquit,
+    :sigkill,
+    :sigusr1,
+    :sigusr2,
+    :sigalrm,
+    :sigterm,
+    :sigcont,
+    :sigstop,
+    :sigtstp,
+    :sigwinch
+  ]
+
+  @doc """
+  Configure inactivity tracking. The timeouts are tracked by the port itself
+  and start once a command is executed.
+
+  ## Options
+
+    * `:quiet` - after the command produced output and then stayed silent
+      for the given milliseconds, the handler receives `{pty, {:quiet, ms}}`
+    * `:idle_input` - milliseconds without any data sent to the pty before
+      the session is considered idle
+    * `:idle_output` - milliseconds without any output before the session
+      is considered idle
+    * `:idle_action` - what happens when the session becomes idle, in any case
+      the handler receives `{pty, {:idle, :input | :output}}` first:
+      * `:notify` (default) - nothing else
+      * `:close` - the session is terminated like with `kill/2` and a grace
+        period of 5 seconds
+      * `{:signal, sig}` - `sig` (e.g. `:sigint`) is delivered to the
+        foreground process group
+
+  A timeout of `0` disables it. Calling `set_timeouts/2` again only changes
+  the given options and keeps the earlier settings of all others.
+
+  ## Example
+
+      iex> ExPTY.set_timeouts(pty, quiet: 200, idle_input: 600_000, idle_action: :close)
+  """
+  def set_timeouts(server, timeouts) do
+    timeouts =
+      timeouts
+      |> Keyword.validate!([:quiet, :idle_input, :idle_output, :idle_action])
+      |> Enum.map(&map_timeout/1)
+
+    GenServer.call(server, {:timeouts, timeouts})
+  end
+
+  @doc """
+  Deliver a signal to the foreground process group of the pty.
+
+  Supported signals are `:sighup`, `:sigint`, `:sigquit`, `:sigkill`,
+  `:sigusr1`, `:sigusr2`, `:sigalrm`, `:sigterm`, `:sigcont`, `:sigstop`,
+  `:sigtstp` and `:sigwinch`.
+
+  Returns `:ok` or `{:error, errno}`.
+
+  ## Example
+
+      iex> ExPTY.signal(pty, :sigint)
+  """
+  def signal(server, sig) when sig in @signals do
+    GenServer.call(server, {:signal, sig})
+  end
+
+  @doc """
+  Terminate the session and close the pty.
+
+  The foreground process group and the process group of the session leader
+  receive `SIGTERM` followed by `SIGCONT`, so that stopped jobs can handle it.
+  On Linux, all other processes of the session, such as background jobs in
+  process groups of their own, are signaled as well. They are looked up once
+  in `/proc` or, if the command joined a cgroup of its own, in its
+  `cgroup.procs`. On other platforms only the two process groups are signaled.
+
+  Whatever is still running after `grace_ms` milliseconds is killed with
+  `SIGKILL`, after looking once more for new processes of the session.
+  Afterwards the pty exits and the handler receives `{:EXIT, pty, :normal}`.
+  """
+  def kill(server, grace_ms \\ 5000) when is_integer(grace_ms) and grace_ms >= 0 do
+    GenServer.call(server, {:kill, grace_ms})
+  end
+
+  @doc """
+  Returns the OS pid of the port program managing the pty.
+  """
+  def os_pid(server) do
+    GenServer.call(server, :os_pid)
+  end
+
   @doc """
   Change the window size of the pty.
   """
@@ -130,4 +294,56 @@ defmodule ExPTY do
 
   defp map_env({key, value}), do: to_string(key) <> "=" <> to_string(value)
   defp map_env(str) when is_binary(str), do: str
+
+  defp map_exec_opt({:rlimit, limits}), do: {:rlimit, Enum.map(limits, &map_rlimit/1)}
+
+  defp map_exec_opt({:affinity, cpus} = opt) when is_list(cpus) do
+    if Enum.all?(cpus, &(is_integer(&1) and &1 >= 0)) do
+      opt
+    else
+      raise ArgumentError, "invalid exec option #{inspect(opt)}"
+    end
+  end
+
+  defp map_exec_opt({:nice, nice}) when is_integer(nice), do: {:nice, nice}
+
+  defp map_exec_opt({:ionice, {class, level}})
+       when class in [:realtime, :best_effort, :idle] and level in 0..7,
+       do: {:ionice, {class, level}}
+
+  defp map_exec_opt({:cgroup, path}) when is_binary(path) or is_list(path),
+    do: {:cgroup, to_string(path)}
+
+  defp map_exec_opt(opt) do
+    raise ArgumentError, "invalid exec option #{inspect(opt)}"
+  end
+
+  defp map_timeout({key, ms})
+       when key in [:quiet, :idle_input, :idle_output] and is_integer(ms) and ms >= 0,
+       do: {key, ms}
+
+  defp map_timeout({:idle_action, action}) when action in [:notify, :close],
+    do: {:idle_action, action}
+
+  defp map_timeout({:idle_action, {:signal, sig}}) when sig in @signals,
+    do: {:idle_action, {:signal, sig}}
+
+  defp map_timeout(timeout) do
+    raise ArgumentError, "invalid timeout #{inspect(timeout)}"
+  end
+
+  defp map_rlimit({resource, {soft, hard}})
+       when resource in [:cpu, :as, :nofile, :nproc] and
+              (is_integer(soft) or soft == :infinity) and
+              (is_integer(hard) or hard == :infinity),
+       do: {resource, {soft, hard}}
+
+  defp map_rlimit({resource, limit})
+       when resource in [:cpu, :as, :nofile, :nproc] and
+              (is_integer(limit) or limit == :infinity),
+       do: {resource, limit}
+
+  defp map_rlimit(rlimit) do
+    raise ArgumentError, "invalid rlimit #{inspect(rlimit)}"
+  end
 end
@@ -21,6 +21,12 @@ defmodule ExPTYTest do
     assert_receive {^pty, {:data, "echo\r\n"}}
   end
 
+  test "returning the os pid of the port" do
+    {:ok, pty} = ExPTY.start_link()
+
+    assert is_integer(ExPTY.os_pid(pty))
+  end
+
   test "changing the window size" do
     {:ok, pty} = ExPTY.start_link()
 
@@ -62,4 +68,172 @@ defmodule ExPTYTest do
     # no echo result
     refute_receive {^pty, {:data, "no echo\r\n"}}
   end
+
+  test "applying resource limits on exec" do
+    {:ok, pty} = ExPTY.start_link()
+    ExPTY.exec(pty, ["sh", "-c", "echo $(ulimit -n) $(nice)"], [], rlimit: [nofile: 64], nice: 5)
+
+    assert_receive {^pty, {:data, "64 5\r\n"}}, 500
+  end
+
+  test "reporting errors of exec options" do
+    {:ok, pty} = ExPTY.start_link()
+    ExPTY.exec(pty, ["true"], [], cgroup: "/nonexistent/ex_pty")
+
+    # ENOENT
+    assert_receive {^pty, {:exit, 2}}, 500
+  end
+
+  test "setting soft and hard resource limits" do
+    {:ok, pty} = ExPTY.start_link()
+
+    ExPTY.exec(pty, ["sh", "-c", "echo $(ulimit -Sn) $(ulimit -Hn)"], [],
+      rlimit: [nofile: {32, 64}]
+    )
+
+    assert_receive {^pty, {:data, "32 64\r\n"}}, 500
+  end
+
+  test "rejecting exec commands that exceed the port buffer" do
+    {:ok, pty} = ExPTY.start_link()
+
+    assert_raise ArgumentError, fn ->
+      ExPTY.exec(pty, ["true"], [], cgroup: String.duplicate("a", 2000))
+    end
+  end
+
+  @tag :linux
+  test "pinning the command to cpus" do
+    {:ok, pty} = ExPTY.start_link()
+    ExPTY.exec(pty, ["grep", "Cpus_allowed_list", "/proc/self/status"], [], affinity: [0])
+
+    assert_receive {^pty, {:data, "Cpus_allowed_list:\t0\r\n"}}, 500
+  end
+
+  @tag :linux
+  test "setting the io priority" do
+    {:ok, pty} = ExPTY.start_link()
+    ExPTY.exec(pty, ["sh", "-c", "ionice -p $$"], [], ionice: {:best_effort, 6})
+
+    assert_receive {^pty, {:data, "best-effort: prio 6\r\n"}}, 500
+  end
+
+  test "rejecting invalid exec options" do
+    {:ok, pty} = ExPTY.start_link()
+
+    assert_raise ArgumentError, fn -> ExPTY.exec(pty, ["true"], [], affinity: [0, "1"]) end
+    assert_raise ArgumentError, fn -> ExPTY.exec(pty, ["true"], [], affinity: [-1]) end
+    assert_raise ArgumentError, fn -> ExPTY.exec(pty, ["true"], [], ionice: {:idle, 8}) end
+    assert_raise ArgumentError, fn -> ExPTY.exec(pty, ["true"], [], rlimit: [nofile: "64"]) end
+  end
+
+  @tag :cgroup
+  test "joining a cgroup" do
+    cgroup = Path.join("/sys/fs/cgroup", "ex_pty_test_#{System.unique_integer([:positive])}")
+    File.mkdir!(cgroup)
+    on_exit(fn -> File.rmdir(cgroup) end)
+
+    {:ok, pty} = ExPTY.start_link()
+    ExPTY.exec(pty, ["cat", "/proc/self/cgroup"], [], cgroup: cgroup)
+
+    assert_receive {^pty, {:data, data}}, 500
+    assert data =~ "0::/" <> Path.basename(cgroup)
+  end
+
+  test "notifying when output settles" do
+    {:ok, pty} = ExPTY.start_link()
+    :ok = ExPTY.set_timeouts(pty, quiet: 100)
+    ExPTY.exec(pty, ["cat"])
+
+    refute_receive {^pty, {:quiet, _}}, 200
+    ExPTY.send_data(pty, "echo\n")
+    assert_receive {^pty, {:data, "echo\r\n"}}
+    assert_receive {^pty, {:quiet, 100}}, 500
+  end
+
+  test "closing idle sessions" do
+    {:ok, pty} = ExPTY.start_link()
+    Process.flag(:trap_exit, true)
+    :ok = ExPTY.set_timeouts(pty, idle_input: 100, idle_action: :close)
+    ExPTY.exec(pty, ["cat"])
+
+    assert_receive {^pty, {:idle, :input}}, 500
+    assert_receive {:EXIT, ^pty, _}, 500
+  end
+
+  test "rejecting invalid timeouts" do
+    {:ok, pty} = ExPTY.start_link()
+
+    assert_raise ArgumentError, fn -> ExPTY.set_timeouts(pty, quiet: -1) end
+    assert_raise ArgumentError, fn -> ExPTY.set_timeouts(pty, idle_input: "100") end
+    assert_raise ArgumentError, fn -> ExPTY.set_timeouts(pty, idle_action: {:signal, :sigfoo}) end
+  end
+
+  test "signaling idle sessions" do
+    {:ok, pty} = ExPTY.start_link()
+    :ok = ExPTY.set_timeouts(pty, idle_output: 100, idle_action: {:signal, :sigterm})
+    ExPTY.exec(pty, ["sh", "-c", "trap 'echo terminated' TERM; sleep 1 & wait"])
+
+    assert_receive {^pty, {:idle, :output}}, 500
+    assert_receive {^pty, {:data, "terminated\r\n"}}, 500
+  end
+
+  test "signaling the foreground process group" do
+    {:ok, pty} = ExPTY.start_link()
+    ExPTY.exec(pty, [
+      "sh",
+      "-c",
+      "trap 'echo interrupted; exit' INT; echo started; sleep 5 & wait"
+    ])
+
+    assert_receive {^pty, {:data, "started\r\n"}}, 500
+    :ok = ExPTY.signal(pty, :sigint)
+    assert_receive {^pty, {:data, "interrupted\r\n"}}, 500
+  end
+
+  @tag :linux
+  test "killing the session" do
+    {:ok, pty} = ExPTY.start_link()
+    Process.flag(:trap_exit, true)
+    ExPTY.exec(pty, ["sh", "-c", "trap '' TERM; sleep 5 & echo $$ $!; wait"])
+
+    assert_receive {^pty, {:data, pids}}, 500
+    :ok = ExPTY.kill(pty, 100)
+    assert_receive {:EXIT, ^pty, :normal}, 500
+    assert_gone(pids)
+  end
+
+  @tag :linux
+  test "killing background jobs in their own process group" do
+    {:ok, pty} = ExPTY.start_link()
+    Process.flag(:trap_exit, true)
+    # set -m enables job control, so the job gets a process group of its own
+    ExPTY.exec(pty, [
+      "sh",
+      "-c",
+      "set -m; sh -c \"trap '' TERM HUP; sleep 5\" & echo $$ $!; wait"
+    ])
+
+    assert_receive {^pty, {:data, pids}}, 500
+    :ok = ExPTY.kill(pty, 100)
+    assert_receive {:EXIT, ^pty, :normal}, 500
+    assert_gone(pids)
+  end
+
+  # SIGKILL is delivered asynchronously, give the kernel a moment to reap
+  defp assert_gone(pids, attempts \\ 50) do
+    running = Enum.filter(String.split(pids), &File.exists?("/proc/#{&1}"))
+
+    cond do
+      running == [] ->
+        :ok
+
+      attempts > 0 ->
+        Process.sleep(10)
+        assert_gone(Enum.join(running, " "), attempts - 1)
+
+      true ->
+        flunk("processes #{Enum.join(running, ", ")} are still running")
+    end
+  end
 end
@@ -1 +1,19 @@
-ExUnit.start()
+exclude =
+  case :os.type() do
+    {:unix, :linux} -> []
+    _ -> [:linux, :cgroup]
+  end
+
+# joining a cgroup needs a writable cgroup v2 hierarchy mounted at /sys/fs/cgroup
+cgroup_probe = "/sys/fs/cgroup/ex_pty_test_probe"
+
+exclude =
+  with true <- File.exists?("/sys/fs/cgroup/cgroup.controllers"),
+       :ok <- File.mkdir(cgroup_probe),
+       :ok <- File.rmdir(cgroup_probe) do
+    exclude
+  else
+    _ -> [:cgroup | exclude]
+  end
+
+ExUnit.start(exclude: exclude)